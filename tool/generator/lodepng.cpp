@@ -39,6 +39,19 @@ Rename this file to lodepng.cpp to use it for C++, or to lodepng.c to use it for
 #include <stdlib.h> /* allocations */
 #endif /* LODEPNG_COMPILE_ALLOCATORS */
 
+/*SSE2 and SSE4.1 unfilter kernels for x86, picked at runtime, see unfilterScanline*/
+#if !defined(LODEPNG_NO_COMPILE_SIMD) && \
+    (defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__))
+#define LODEPNG_COMPILE_SSE
+#include <emmintrin.h>
+#include <smmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h> /* __cpuid */
+#else
+#include <cpuid.h> /* __get_cpuid */
+#endif
+#endif
+
 #if defined(_MSC_VER) && (_MSC_VER >= 1310) /*Visual Studio: A few warning types are not desired here.*/
 #pragma warning( disable : 4244 ) /*implicit conversions: not warned by gcc -Wall -Wextra and requires too much casts*/
 #pragma warning( disable : 4996 ) /*VS does not like fopen, but fopen_s is not standard C so unusable here*/
@@ -123,6 +136,16 @@ static void lodepng_memcpy(void* LODEPNG_RESTRICT dst,
   for(i = 0; i < size; i++) ((char*)dst)[i] = ((const char*)src)[i];
 }
 
+/* the same as lodepng_memcpy, but dst and src may overlap */
+static void lodepng_memmove(void* dst, const void* src, size_t size) {
+  size_t i;
+  if((char*)dst < (const char*)src) {
+    for(i = 0; i < size; i++) ((char*)dst)[i] = ((const char*)src)[i];
+  } else {
+    for(i = size; i > 0; i--) ((char*)dst)[i - 1] = ((const char*)src)[i - 1];
+  }
+}
+
 static void lodepng_memset(void* LODEPNG_RESTRICT dst,
                            int value, size_t num) {
   size_t i;
@@ -1258,12 +1281,255 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
   return error;
 }
 
+/*
+Receiver of the inflated data in pieces, for inflating without holding all of the output in memory.
+The inflater then uses out as a sliding window: once it holds more than INFLATE_WINDOW_SIZE + flushsize
+bytes, all but the last INFLATE_WINDOW_SIZE bytes (the furthest a deflate distance can reach back) are
+passed to write and dropped from out. A non-zero return value of write stops inflating with that error.
+*/
+typedef struct InflateSink {
+  unsigned (*write)(struct InflateSink* sink, const unsigned char* data, size_t size);
+  size_t flushsize;
+  unsigned adler; /*adler32 of all the data passed to write so far*/
+} InflateSink;
+
+#define INFLATE_WINDOW_SIZE 32768u
+
+static unsigned update_adler32(unsigned adler, const unsigned char* data, unsigned len);
+
+/*passes all but the last keep bytes of out to the sink*/
+static unsigned inflateSinkFlush(ucvector* out, InflateSink* sink, size_t keep) {
+  unsigned error;
+  size_t size = out->size - keep;
+  if(size == 0) return 0;
+  sink->adler = update_adler32(sink->adler, out->data, (unsigned)size);
+  error = sink->write(sink, out->data, size);
+  if(error) return error;
+  lodepng_memmove(out->data, out->data + size, keep);
+  out->size = keep;
+  return 0;
+}
+
+#ifndef LODEPNG_NO_COMPILE_FAST_INFLATE
+/*
+Fast path of inflateHuffmanBlock, used while there are at least 8 bytes of input left. Rather than
+ensuring bits per symbol, it keeps a 64-bit bit buffer that is refilled without branches once per symbol
+(which then holds at least 56 bits, enough for a length, a distance and their extra bits), and decodes
+through tables indexed by the next FAST_LITLEN_BITS or FAST_DIST_BITS bits:
+*) a litlen entry holds up to 3 literals that fit in those bits together, or a length base and its number
+   of extra bits, or the end code, so runs of short literals take one lookup per 3 of them
+*) a dist entry holds a distance base and its number of extra bits
+Symbols longer than that (and invalid ones) fall back to the HuffmanTree tables. Matches are copied 8 bytes
+at a time, which may write a few bytes past them, so this stops when out has less than FAST_OUT_MARGIN bytes
+of room left.
+*/
+
+#define FAST_LITLEN_BITS 11u
+#define FAST_DIST_BITS 9u
+#define FAST_OUT_MARGIN (258u + 16u)
+
+/*litlen entry: bits 0-3 the code length(s), bits 4-6 the kind, bits 8-31 up to 3 literals or, for a length,
+bits 8-16 the base and 20-23 the extra bits. An entry of 0 means: decode with the HuffmanTree*/
+#define FAST_KIND_LENGTH 4u
+#define FAST_KIND_END 5u
+
+/*returns the symbol in the (at least 15) bits, or INVALIDSYMBOL, and its code length in *len*/
+static unsigned huffmanDecodeSymbolBits(const HuffmanTree* codetree, unsigned bits, unsigned* len) {
+  unsigned code = bits & ((1u << FIRSTBITS) - 1u);
+  unsigned l = codetree->table_len[code];
+  if(l <= FIRSTBITS) {
+    *len = l;
+    return codetree->table_value[code];
+  } else {
+    unsigned index2 = codetree->table_value[code] + ((bits >> FIRSTBITS) & ((1u << (l - FIRSTBITS)) - 1u));
+    *len = codetree->table_len[index2];
+    return codetree->table_value[index2];
+  }
+}
+
+static void makeFastLitLenTable(unsigned* table, const HuffmanTree* tree_ll) {
+  unsigned i;
+  for(i = 0; i != (1u << FAST_LITLEN_BITS); ++i) {
+    unsigned l, symbol = huffmanDecodeSymbolBits(tree_ll, i, &l);
+    if(l > FAST_LITLEN_BITS || symbol == INVALIDSYMBOL) {
+      table[i] = 0;
+    } else if(symbol <= 255) {
+      /*append the following literals as long as their codes are within the index bits too*/
+      unsigned numliterals = 1, total = l, literals = symbol;
+      while(numliterals != 3) {
+        unsigned l2, symbol2 = huffmanDecodeSymbolBits(tree_ll, i >> total, &l2);
+        if(symbol2 > 255 || total + l2 > FAST_LITLEN_BITS) break;
+        literals |= symbol2 << (8u * numliterals);
+        total += l2;
+        ++numliterals;
+      }
+      table[i] = total | (numliterals << 4u) | (literals << 8u);
+    } else if(symbol == 256) {
+      table[i] = l | (FAST_KIND_END << 4u);
+    } else if(symbol <= LAST_LENGTH_CODE_INDEX) {
+      table[i] = l | (FAST_KIND_LENGTH << 4u) | (LENGTHBASE[symbol - FIRST_LENGTH_CODE_INDEX] << 8u)
+               | (LENGTHEXTRA[symbol - FIRST_LENGTH_CODE_INDEX] << 20u);
+    } else {
+      table[i] = 0; /*invalid symbol, gives the error in the fallback*/
+    }
+  }
+}
+
+/*dist entry: bits 0-3 the code length, 4-7 the extra bits, 8-23 the base. 0 means: decode with the HuffmanTree*/
+static void makeFastDistTable(unsigned* table, const HuffmanTree* tree_d) {
+  unsigned i;
+  for(i = 0; i != (1u << FAST_DIST_BITS); ++i) {
+    unsigned l, symbol = huffmanDecodeSymbolBits(tree_d, i, &l);
+    if(l > FAST_DIST_BITS || symbol > 29) table[i] = 0;
+    else table[i] = l | (DISTANCEEXTRA[symbol] << 4u) | (DISTANCEBASE[symbol] << 8u);
+  }
+}
+
+/*little endian 64-bit load of unaligned data*/
+static LODEPNG_INLINE unsigned long long readLE64(const unsigned char* data) {
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__) || \
+    (defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__))
+  unsigned long long result;
+  memcpy(&result, data, 8);
+  return result;
+#else
+  return (unsigned long long)data[0] | ((unsigned long long)data[1] << 8u) |
+         ((unsigned long long)data[2] << 16u) | ((unsigned long long)data[3] << 24u) |
+         ((unsigned long long)data[4] << 32u) | ((unsigned long long)data[5] << 40u) |
+         ((unsigned long long)data[6] << 48u) | ((unsigned long long)data[7] << 56u);
+#endif
+}
+
+/*Decodes symbols of the block until its end (then sets *done), or until less than 8 bytes of input or
+FAST_OUT_MARGIN bytes of room in out are left, leaving the reader at the next symbol*/
+static unsigned inflateHuffmanBlockFast(ucvector* out, LodePNGBitReader* reader,
+                                        const HuffmanTree* tree_ll, const HuffmanTree* tree_d,
+                                        InflateSink* sink, unsigned* done) {
+  unsigned error = 0;
+  unsigned litlentable[1u << FAST_LITLEN_BITS];
+  unsigned disttable[1u << FAST_DIST_BITS];
+  const unsigned char* in = reader->data + (reader->bp >> 3u);
+  const unsigned char* inend = reader->data + reader->size;
+  unsigned long long bitbuf = 0;
+  unsigned bitsleft = 0; /*valid bits in bitbuf, any bits above it are 0 or the bits that follow them*/
+  unsigned char* o = out->data + out->size;
+  unsigned char* oend = out->data + out->allocsize;
+
+  if(inend - in < 8 || (size_t)(oend - o) < FAST_OUT_MARGIN) return 0;
+
+  makeFastLitLenTable(litlentable, tree_ll);
+  makeFastDistTable(disttable, tree_d);
+
+/*bitbuf gets 56 to 63 valid bits: loads 8 bytes but only advances over the whole bytes that fit*/
+#define FAST_REFILL() {\
+  bitbuf |= readLE64(in) << bitsleft;\
+  in += (63u - bitsleft) >> 3u;\
+  bitsleft |= 56u;\
+}
+#define FAST_CONSUME(n) { bitbuf >>= (n); bitsleft -= (n); }
+
+  FAST_REFILL();
+  FAST_CONSUME(reader->bp & 7u);
+
+  while(inend - in >= 8) {
+    unsigned entry, kind, length, distance;
+
+    if(sink && (size_t)(o - out->data) >= INFLATE_WINDOW_SIZE + sink->flushsize) {
+      out->size = (size_t)(o - out->data);
+      error = inflateSinkFlush(out, sink, INFLATE_WINDOW_SIZE);
+      if(error) break;
+      o = out->data + out->size;
+    }
+    /*no room for the longest match plus overcopy: leave the rest to the regular loop, which grows out as needed
+    (growing it here would overallocate when it was reserved to the exact expected size)*/
+    if((size_t)(oend - o) < FAST_OUT_MARGIN) break;
+
+    FAST_REFILL();
+    entry = litlentable[bitbuf & ((1u << FAST_LITLEN_BITS) - 1u)];
+    kind = (entry >> 4u) & 7u;
+
+    if(kind == 0) {
+      /*long or invalid code, decode it the regular way and turn it into an entry*/
+      unsigned l, symbol = huffmanDecodeSymbolBits(tree_ll, (unsigned)bitbuf, &l);
+      if(symbol <= 255) entry = l | (1u << 4u) | (symbol << 8u);
+      else if(symbol == 256) entry = l | (FAST_KIND_END << 4u);
+      else if(symbol <= LAST_LENGTH_CODE_INDEX) {
+        entry = l | (FAST_KIND_LENGTH << 4u) | (LENGTHBASE[symbol - FIRST_LENGTH_CODE_INDEX] << 8u)
+              | (LENGTHEXTRA[symbol - FIRST_LENGTH_CODE_INDEX] << 20u);
+      }
+      else ERROR_BREAK(16); /*error: tried to read disallowed huffman symbol*/
+      kind = (entry >> 4u) & 7u;
+    }
+    FAST_CONSUME(entry & 15u);
+
+    if(kind <= 3) /*literals*/ {
+      o[0] = (unsigned char)(entry >> 8u);
+      o[1] = (unsigned char)(entry >> 16u);
+      o[2] = (unsigned char)(entry >> 24u);
+      o += kind;
+      continue;
+    } else if(kind == FAST_KIND_END) {
+      *done = 1;
+      break;
+    }
+
+    /*length, with its extra bits*/
+    length = (entry >> 8u) & 511u;
+    length += (unsigned)bitbuf & ((1u << ((entry >> 20u) & 15u)) - 1u);
+    FAST_CONSUME((entry >> 20u) & 15u);
+
+    /*distance, with its extra bits*/
+    entry = disttable[bitbuf & ((1u << FAST_DIST_BITS) - 1u)];
+    if(entry == 0) {
+      unsigned l, symbol = huffmanDecodeSymbolBits(tree_d, (unsigned)bitbuf, &l);
+      if(symbol > 29) {
+        if(symbol <= 31) ERROR_BREAK(18); /*error: invalid distance code (30-31 are never used)*/
+        ERROR_BREAK(16); /*error: tried to read disallowed huffman symbol*/
+      }
+      entry = l | (DISTANCEEXTRA[symbol] << 4u) | (DISTANCEBASE[symbol] << 8u);
+    }
+    FAST_CONSUME(entry & 15u);
+    distance = (entry >> 8u) + ((unsigned)bitbuf & ((1u << ((entry >> 4u) & 15u)) - 1u));
+    FAST_CONSUME((entry >> 4u) & 15u);
+
+    if(distance > (size_t)(o - out->data)) ERROR_BREAK(52); /*too long backward distance*/
+
+    {
+      const unsigned char* src = o - distance;
+      unsigned char* end = o + length;
+      if(distance >= 8) {
+        /*8 byte chunks never overlap the part they are copied from, the last one may go past end*/
+        do {
+          memcpy(o, src, 8);
+          o += 8;
+          src += 8;
+        } while(o < end);
+      } else if(distance == 1) {
+        memset(o, *src, length);
+      } else {
+        while(o != end) *o++ = *src++;
+      }
+      o = end;
+    }
+  }
+
+#undef FAST_REFILL
+#undef FAST_CONSUME
+
+  out->size = (size_t)(o - out->data);
+  /*give back the bits that were loaded but not used*/
+  reader->bp = (size_t)(in - reader->data) * 8u - bitsleft;
+  return error;
+}
+#endif /*LODEPNG_NO_COMPILE_FAST_INFLATE*/
+
 /*inflate a block with dynamic of fixed Huffman tree. btype must be 1 or 2.*/
 static unsigned inflateHuffmanBlock(ucvector* out, LodePNGBitReader* reader,
-                                    unsigned btype) {
+                                    unsigned btype, InflateSink* sink) {
   unsigned error = 0;
   HuffmanTree tree_ll; /*the huffman tree for literal and length codes*/
   HuffmanTree tree_d; /*the huffman tree for distance codes*/
+  unsigned done = 0; /*set when the fast path already got to the end code*/
 
   HuffmanTree_init(&tree_ll);
   HuffmanTree_init(&tree_d);
@@ -1271,9 +1537,17 @@ static unsigned inflateHuffmanBlock(ucvector* out, LodePNGBitReader* reader,
   if(btype == 1) error = getTreeInflateFixed(&tree_ll, &tree_d);
   else /*if(btype == 2)*/ error = getTreeInflateDynamic(&tree_ll, &tree_d, reader);
 
-  while(!error) /*decode all symbols until end reached, breaks at end code*/ {
+#ifndef LODEPNG_NO_COMPILE_FAST_INFLATE
+  if(!error) error = inflateHuffmanBlockFast(out, reader, &tree_ll, &tree_d, sink, &done);
+#endif /*LODEPNG_NO_COMPILE_FAST_INFLATE*/
+
+  while(!error && !done) /*decode the remaining symbols until end reached, breaks at end code*/ {
     /*code_ll is literal, length or end code*/
     unsigned code_ll;
+    if(sink && out->size >= INFLATE_WINDOW_SIZE + sink->flushsize) {
+      error = inflateSinkFlush(out, sink, INFLATE_WINDOW_SIZE);
+      if(error) break;
+    }
     ensureBits25(reader, 20); /* up to 15 for the huffman symbol, up to 5 for the length extra bits */
     code_ll = huffmanDecodeSymbol(reader, &tree_ll);
     if(code_ll <= 255) /*literal symbol*/ {
@@ -1381,28 +1655,461 @@ static unsigned inflateNoCompression(ucvector* out, LodePNGBitReader* reader,
   return error;
 }
 
+/*inflates one block of any type, *final gets its BFINAL bit*/
+static unsigned inflateBlock(ucvector* out, LodePNGBitReader* reader, const LodePNGDecompressSettings* settings,
+                             InflateSink* sink, unsigned* final) {
+  unsigned BTYPE;
+  if(!ensureBits9(reader, 3)) return 52; /*error, bit pointer will jump past memory*/
+  *final = readBits(reader, 1);
+  BTYPE = readBits(reader, 2);
+
+  if(BTYPE == 3) return 20; /*error: invalid BTYPE*/
+  else if(BTYPE == 0) return inflateNoCompression(out, reader, settings); /*no compression*/
+  else return inflateHuffmanBlock(out, reader, BTYPE, sink); /*compression, BTYPE 01 or 10*/
+}
+
+/*
+Parallel inflate, used by lodepng_inflatev when settings->parallel_for is set, in the way of pugz.
+The stream is inflated in rounds of settings->parallel_jobs pieces of INFLATE_PARALLEL_CHUNK_SIZE compressed bytes.
+The first piece of a round starts where the previous round stopped, with the output before it known. The others
+can only guess where to start: at the first bit from their nominal start where a dynamic huffman block header is
+valid and its block inflates. Whatever they copy from the unknown 32K before them is inflated symbolically, as
+16-bit values (a byte, or 256 + its position in that window), until the last 32K of their output holds no window
+positions anymore. From there on they inflate to bytes with the regular code. Every piece stops at the first block
+boundary at or after the nominal start of the next one.
+When all pieces of the round are done, they are checked in order: a guessed piece is used if it started where the
+one before it stopped, and then its window positions are filled in from the output before it. Any part of the
+stream that no piece inflated right is inflated again on this thread. The output of the round is passed on (to
+out or the sink) during the next round, by an extra job.
+*/
+
+#define INFLATE_PARALLEL_CHUNK_SIZE 2097152u
+
+typedef struct InflatePiece {
+  size_t startbit; /*where it starts, or for a guessed piece where it starts looking*/
+  size_t stopbit; /*it stops at the first block boundary at or after this*/
+  unsigned guessed;
+  unsigned error; /*a piece with an error is not used, a real error shows when that part is inflated again*/
+  size_t begin, end; /*the bits it really started and stopped at*/
+  unsigned final; /*whether it stopped at the end of the final block*/
+  ucvector symbols; /*the symbolic part of the output, 2 bytes per value, 1 per byte once filled in*/
+  size_t numsymbols;
+  ucvector bytes; /*the rest of the output, after keep bytes of the output before it*/
+  size_t keep;
+} InflatePiece;
+
+typedef struct InflateRound {
+  const LodePNGDecompressSettings* settings;
+  const LodePNGBitReader* reader;
+  const ucvector* window; /*the last 32K of output before the round*/
+  InflatePiece* pieces;
+  unsigned numpieces;
+  /*the output of the previous round, passed on by job 0*/
+  InflatePiece* done;
+  unsigned numdone;
+  ucvector* out;
+  InflateSink* sink;
+  unsigned error;
+} InflateRound;
+
+static void InflatePiece_init(InflatePiece* piece, size_t startbit, size_t stopbit, unsigned guessed) {
+  piece->startbit = startbit;
+  piece->stopbit = stopbit;
+  piece->guessed = guessed;
+  piece->error = 0;
+  piece->begin = piece->end = startbit;
+  piece->final = 0;
+  piece->symbols = ucvector_init(0, 0);
+  piece->numsymbols = 0;
+  piece->bytes = ucvector_init(0, 0);
+  piece->keep = 0;
+}
+
+static void InflatePiece_cleanup(InflatePiece* piece) {
+  lodepng_free(piece->symbols.data);
+  lodepng_free(piece->bytes.data);
+  piece->symbols = piece->bytes = ucvector_init(0, 0);
+}
+
+/*sum of 2^(15 - length) over the used codes, 2^15 for a complete code*/
+static unsigned huffmanCodeSpace(const HuffmanTree* tree) {
+  unsigned i, space = 0;
+  for(i = 0; i != tree->numcodes; ++i) {
+    if(tree->lengths[i]) space += 1u << (15u - tree->lengths[i]);
+  }
+  return space;
+}
+
+/*Reads the header of a block as zlib writes it, if the reader is at one: not final, dynamic huffman, and complete
+codes (zlib gives every code at least 2 symbols). Most bit positions already fail the checks before the trees.*/
+static unsigned readDynamicBlockStart(LodePNGBitReader* reader, HuffmanTree* tree_ll, HuffmanTree* tree_d) {
+  LodePNGBitReader r = *reader;
+  unsigned header, HCLEN, i, space = 0;
+  if(!ensureBits17(&r, 17)) return 0;
+  header = readBits(&r, 17);
+  /*BFINAL 0 and BTYPE 2, HLIT and HDIST of at most 286 and 30 codes*/
+  if((header & 7u) != 4u || ((header >> 3u) & 31u) > 29u || ((header >> 8u) & 31u) > 29u) return 0;
+  HCLEN = (header >> 13u) + 4u;
+  if(r.bp + HCLEN * 3u > r.bitsize) return 0;
+  for(i = 0; i != HCLEN; ++i) {
+    unsigned length;
+    ensureBits9(&r, 3);
+    length = readBits(&r, 3);
+    if(length) space += 64u >> (length - 1u);
+  }
+  if(space != 128u) return 0; /*the code length code is not complete*/
+
+  HuffmanTree_cleanup(tree_ll);
+  HuffmanTree_cleanup(tree_d);
+  HuffmanTree_init(tree_ll);
+  HuffmanTree_init(tree_d);
+  r.bp = reader->bp + 3u;
+  if(getTreeInflateDynamic(tree_ll, tree_d, &r)) return 0;
+  if(huffmanCodeSpace(tree_ll) != (1u << 15u) || huffmanCodeSpace(tree_d) != (1u << 15u)) return 0;
+  *reader = r;
+  return 1;
+}
+
+/*inflates the symbols of a huffman block to 16-bit values, see inflateParallel. *lastref becomes 1 + the index of
+the last value that is a window position*/
+static unsigned inflateHuffmanBlockSymbolic(InflatePiece* piece, LodePNGBitReader* reader,
+                                            const HuffmanTree* tree_ll, const HuffmanTree* tree_d, size_t* lastref) {
+  unsigned error = 0;
+  for(;;) {
+    unsigned code_ll;
+    unsigned short* values;
+    ensureBits25(reader, 20); /* up to 15 for the huffman symbol, up to 5 for the length extra bits */
+    code_ll = huffmanDecodeSymbol(reader, tree_ll);
+    if(code_ll <= 255) /*literal symbol*/ {
+      if(!ucvector_resize(&piece->symbols, (piece->numsymbols + 1u) * 2u)) ERROR_BREAK(83 /*alloc fail*/);
+      values = (unsigned short*)piece->symbols.data;
+      values[piece->numsymbols++] = (unsigned short)code_ll;
+    } else if(code_ll >= FIRST_LENGTH_CODE_INDEX && code_ll <= LAST_LENGTH_CODE_INDEX) /*length code*/ {
+      unsigned code_d;
+      size_t length, distance, i;
+
+      length = LENGTHBASE[code_ll - FIRST_LENGTH_CODE_INDEX];
+      length += readBits(reader, LENGTHEXTRA[code_ll - FIRST_LENGTH_CODE_INDEX]);
+
+      ensureBits32(reader, 28); /* up to 15 for the huffman symbol, up to 13 for the extra bits */
+      code_d = huffmanDecodeSymbol(reader, tree_d);
+      if(code_d > 29) {
+        if(code_d <= 31) ERROR_BREAK(18); /*error: invalid distance code (30-31 are never used)*/
+        ERROR_BREAK(16); /*error: tried to read disallowed huffman symbol*/
+      }
+      distance = DISTANCEBASE[code_d] + readBits(reader, DISTANCEEXTRA[code_d]);
+
+      if(!ucvector_resize(&piece->symbols, (piece->numsymbols + length) * 2u)) ERROR_BREAK(83 /*alloc fail*/);
+      values = (unsigned short*)piece->symbols.data;
+      for(i = piece->numsymbols; i != piece->numsymbols + length; ++i) {
+        /*from before the piece: the position in the window, the byte just before the piece is 256 + 32767*/
+        unsigned value = i >= distance ? values[i - distance] : 256u + (unsigned)(INFLATE_WINDOW_SIZE + i - distance);
+        if(value > 255) *lastref = i + 1u;
+        values[i] = (unsigned short)value;
+      }
+      piece->numsymbols += length;
+    } else if(code_ll == 256) {
+      break; /*end code*/
+    } else /*if(code_ll == INVALIDSYMBOL)*/ {
+      ERROR_BREAK(16); /*error: tried to read disallowed huffman symbol*/
+    }
+    if(reader->bp > reader->bitsize) ERROR_BREAK(51); /*error, bit pointer jumps past memory*/
+  }
+  return error;
+}
+
+/*the symbolic counterpart of inflateBlock*/
+static unsigned inflateBlockSymbolic(InflatePiece* piece, LodePNGBitReader* reader,
+                                     const LodePNGDecompressSettings* settings, size_t* lastref) {
+  unsigned BTYPE, error;
+  HuffmanTree tree_ll, tree_d;
+  if(!ensureBits9(reader, 3)) return 52; /*error, bit pointer will jump past memory*/
+  piece->final = readBits(reader, 1);
+  BTYPE = readBits(reader, 2);
+
+  if(BTYPE == 3) return 20; /*error: invalid BTYPE*/
+  if(BTYPE == 0) {
+    /*stored, through the (still empty) bytes*/
+    size_t i;
+    error = inflateNoCompression(&piece->bytes, reader, settings);
+    if(!error && !ucvector_resize(&piece->symbols, (piece->numsymbols + piece->bytes.size) * 2u)) error = 83;
+    for(i = 0; !error && i != piece->bytes.size; ++i) {
+      ((unsigned short*)piece->symbols.data)[piece->numsymbols++] = piece->bytes.data[i];
+    }
+    piece->bytes.size = 0;
+    return error;
+  }
+
+  HuffmanTree_init(&tree_ll);
+  HuffmanTree_init(&tree_d);
+  if(BTYPE == 1) error = getTreeInflateFixed(&tree_ll, &tree_d);
+  else error = getTreeInflateDynamic(&tree_ll, &tree_d, reader);
+  if(!error) error = inflateHuffmanBlockSymbolic(piece, reader, &tree_ll, &tree_d, lastref);
+  HuffmanTree_cleanup(&tree_ll);
+  HuffmanTree_cleanup(&tree_d);
+  return error;
+}
+
+/*inflates a piece: a guessed one on a job thread, one that is not on a job thread (window is then the output
+before it) or on the main thread to redo a part*/
+static void inflatePiece(InflatePiece* piece, const LodePNGBitReader* stream, const ucvector* window,
+                         const LodePNGDecompressSettings* settings) {
+  LodePNGBitReader reader = *stream;
+  unsigned error = 0;
+  reader.bp = piece->startbit;
+
+  if(piece->guessed) {
+    HuffmanTree tree_ll, tree_d;
+    size_t lastref = 0;
+    HuffmanTree_init(&tree_ll);
+    HuffmanTree_init(&tree_d);
+    /*the first block start where the block inflates, error stays 1 if there is none*/
+    for(error = 1; error && reader.bp < piece->stopbit; reader.bp = ++piece->begin) {
+      piece->begin = reader.bp;
+      if(!readDynamicBlockStart(&reader, &tree_ll, &tree_d)) continue;
+      piece->numsymbols = 0;
+      lastref = 0;
+      error = inflateHuffmanBlockSymbolic(piece, &reader, &tree_ll, &tree_d, &lastref);
+      if(!error) break;
+    }
+    HuffmanTree_cleanup(&tree_ll);
+    HuffmanTree_cleanup(&tree_d);
+    if(error) {
+      piece->error = error;
+      return;
+    }
+
+    /*symbolic until the last 32K of output has no window positions*/
+    while(!error && !piece->final && reader.bp < piece->stopbit && piece->numsymbols - lastref < INFLATE_WINDOW_SIZE) {
+      error = inflateBlockSymbolic(piece, &reader, settings, &lastref);
+    }
+
+    /*the bytes go on from the last 32K of values, which are all bytes now*/
+    piece->keep = piece->numsymbols < INFLATE_WINDOW_SIZE ? piece->numsymbols : INFLATE_WINDOW_SIZE;
+    if(!error && !ucvector_resize(&piece->bytes, piece->keep)) error = 83; /*alloc fail*/
+    if(!error) {
+      const unsigned short* values = (const unsigned short*)piece->symbols.data + piece->numsymbols - piece->keep;
+      size_t i;
+      for(i = 0; i != piece->keep; ++i) piece->bytes.data[i] = (unsigned char)values[i];
+    }
+  } else {
+    piece->keep = window->size;
+    if(!ucvector_resize(&piece->bytes, window->size)) error = 83; /*alloc fail*/
+    else lodepng_memcpy(piece->bytes.data, window->data, window->size);
+  }
+
+  while(!error && !piece->final && reader.bp < piece->stopbit) {
+    error = inflateBlock(&piece->bytes, &reader, settings, 0, &piece->final);
+  }
+  piece->end = reader.bp;
+  piece->error = error;
+}
+
+/*fills in the window positions of a piece from the last 32K of output before it, in place*/
+static unsigned resolvePiece(InflatePiece* piece, const ucvector* window) {
+  const unsigned short* values = (const unsigned short*)piece->symbols.data;
+  size_t i;
+  for(i = 0; i != piece->numsymbols; ++i) {
+    size_t value = values[i];
+    if(value > 255) {
+      value -= 256u;
+      if(value + window->size < INFLATE_WINDOW_SIZE) return 52; /*from before the start of the output*/
+      value = window->data[value + window->size - INFLATE_WINDOW_SIZE];
+    }
+    piece->symbols.data[i] = (unsigned char)value;
+  }
+  piece->symbols.size = piece->numsymbols;
+  return 0;
+}
+
+/*keeps the last 32K of output in window*/
+static void updateWindow(ucvector* window, const unsigned char* data, size_t size) {
+  if(size >= INFLATE_WINDOW_SIZE) {
+    lodepng_memcpy(window->data, data + size - INFLATE_WINDOW_SIZE, INFLATE_WINDOW_SIZE);
+    window->size = INFLATE_WINDOW_SIZE;
+  } else {
+    size_t keep = window->size < INFLATE_WINDOW_SIZE - size ? window->size : INFLATE_WINDOW_SIZE - size;
+    lodepng_memmove(window->data, window->data + window->size - keep, keep);
+    lodepng_memcpy(window->data + keep, data, size);
+    window->size = keep + size;
+  }
+}
+
+static unsigned writeInflated(ucvector* out, InflateSink* sink, const unsigned char* data, size_t size) {
+  if(!sink) {
+    size_t pos = out->size;
+    if(!ucvector_resize(out, pos + size)) return 83; /*alloc fail*/
+    lodepng_memcpy(out->data + pos, data, size);
+    return 0;
+  }
+  while(size != 0) {
+    size_t amount = size < sink->flushsize || sink->flushsize == 0 ? size : sink->flushsize;
+    unsigned error;
+    sink->adler = update_adler32(sink->adler, data, (unsigned)amount);
+    error = sink->write(sink, data, amount);
+    if(error) return error;
+    data += amount;
+    size -= amount;
+  }
+  return 0;
+}
+
+static unsigned writePieces(ucvector* out, InflateSink* sink, const InflatePiece* pieces, unsigned numpieces) {
+  unsigned i, error = 0;
+  for(i = 0; !error && i != numpieces; ++i) {
+    error = writeInflated(out, sink, pieces[i].symbols.data, pieces[i].numsymbols);
+    if(!error) {
+      error = writeInflated(out, sink, pieces[i].bytes.data + pieces[i].keep, pieces[i].bytes.size - pieces[i].keep);
+    }
+  }
+  return error;
+}
+
+static void inflateParallelJob(void* jobs, unsigned i) {
+  InflateRound* round = (InflateRound*)jobs;
+  if(round->numdone != 0) {
+    if(i == 0) {
+      round->error = writePieces(round->out, round->sink, round->done, round->numdone);
+      return;
+    }
+    --i;
+  }
+  inflatePiece(&round->pieces[i], round->reader, round->window, round->settings);
+}
+
+/*the part of inflateParallel that checks the pieces of a round, after the jobs are done: moves the output to done
+in order, and inflates the parts that no piece got right. *bp is where the round started and then where it ended.*/
+static unsigned finishInflateRound(InflatePiece* pieces, unsigned numpieces, InflatePiece* done, unsigned* numdone,
+                                   ucvector* window, size_t* bp, unsigned* final,
+                                   const LodePNGBitReader* reader, const LodePNGDecompressSettings* settings) {
+  unsigned i, error = 0;
+  *numdone = 0;
+  for(i = 0; i <= numpieces; ++i) {
+    /*the part up to where this piece starts, or up to the end of the round after the last piece*/
+    size_t begin = i != numpieces ? pieces[i].begin : pieces[numpieces - 1].stopbit;
+    if(error || *final) break;
+    if(i != numpieces && (pieces[i].error || pieces[i].begin < *bp)) {
+      if(!pieces[i].guessed) error = pieces[i].error; /*the piece started at a known block*/
+      continue;
+    }
+    if(*bp < begin) {
+      InflatePiece* piece = &done[(*numdone)++];
+      InflatePiece_init(piece, *bp, begin, 0);
+      inflatePiece(piece, reader, window, settings);
+      error = piece->error;
+      if(error) break;
+      updateWindow(window, piece->bytes.data + piece->keep, piece->bytes.size - piece->keep);
+      *bp = piece->end;
+      *final = piece->final;
+    }
+    if(i != numpieces && *bp == pieces[i].begin && !*final) {
+      InflatePiece* piece = &done[(*numdone)++];
+      *piece = pieces[i];
+      InflatePiece_init(&pieces[i], 0, 0, 0); /*the piece moved*/
+      error = resolvePiece(piece, window);
+      if(error) break;
+      updateWindow(window, piece->symbols.data, piece->numsymbols);
+      updateWindow(window, piece->bytes.data + piece->keep, piece->bytes.size - piece->keep);
+      *bp = piece->end;
+      *final = piece->final;
+    }
+  }
+  for(i = 0; i != numpieces; ++i) InflatePiece_cleanup(&pieces[i]);
+  return error;
+}
+
+static unsigned inflateParallel(ucvector* out, const LodePNGBitReader* reader,
+                                const LodePNGDecompressSettings* settings, InflateSink* sink) {
+  unsigned jobs = settings->parallel_jobs;
+  size_t chunkbits = (size_t)INFLATE_PARALLEL_CHUNK_SIZE * 8u;
+  size_t bp = 0;
+  unsigned final = 0, error = 0, numpieces, numdone = 0, i;
+  InflatePiece* pieces = (InflatePiece*)lodepng_malloc(jobs * sizeof(InflatePiece));
+  /*two lists of done pieces: the one being written out and the one being made. A round has up to 2 per piece,
+  for a piece and the part before it that is inflated again, and one for the part after the last piece*/
+  InflatePiece* done[2];
+  ucvector window = ucvector_init(0, 0);
+  InflateRound round;
+  done[0] = (InflatePiece*)lodepng_malloc((2u * jobs + 1u) * sizeof(InflatePiece));
+  done[1] = (InflatePiece*)lodepng_malloc((2u * jobs + 1u) * sizeof(InflatePiece));
+
+  if(!pieces || !done[0] || !done[1] || !ucvector_resize(&window, INFLATE_WINDOW_SIZE)) error = 83; /*alloc fail*/
+  window.size = 0;
+  /*like the regular code, what is already in out is in the window*/
+  if(!error && !sink) updateWindow(&window, out->data, out->size);
+
+  round.settings = settings;
+  round.reader = reader;
+  round.window = &window;
+  round.pieces = pieces;
+  round.out = out;
+  round.sink = sink;
+
+  while(!error && !final) {
+    size_t left = reader->bitsize - bp;
+    numpieces = (unsigned)((left + chunkbits - 1u) / chunkbits);
+    if(numpieces > jobs) numpieces = jobs;
+    if(numpieces == 0) numpieces = 1;
+    for(i = 0; i != numpieces; ++i) {
+      InflatePiece_init(&pieces[i], bp + i * chunkbits, bp + (i + 1u) * chunkbits, i != 0);
+    }
+
+    round.numpieces = numpieces;
+    round.done = done[0];
+    round.numdone = numdone;
+    round.error = 0;
+    settings->parallel_for(inflateParallelJob, &round, numpieces + (numdone != 0 ? 1u : 0u), settings);
+    for(i = 0; i != numdone; ++i) InflatePiece_cleanup(&done[0][i]);
+    error = round.error;
+
+    if(!error) {
+      error = finishInflateRound(pieces, numpieces, done[1], &numdone, &window, &bp, &final, reader, settings);
+    } else {
+      for(i = 0; i != numpieces; ++i) InflatePiece_cleanup(&pieces[i]);
+      numdone = 0;
+    }
+    /*the pieces just done are written out during the next round*/
+    round.done = done[1];
+    done[1] = done[0];
+    done[0] = round.done;
+  }
+
+  if(!error) error = writePieces(out, sink, done[0], numdone);
+  for(i = 0; i != numdone; ++i) InflatePiece_cleanup(&done[0][i]);
+
+  lodepng_free(pieces);
+  lodepng_free(done[0]);
+  lodepng_free(done[1]);
+  lodepng_free(window.data);
+  return error;
+}
+
+/*sink may be NULL, to get all of the output in out*/
 static unsigned lodepng_inflatev(ucvector* out,
                                  const unsigned char* in, size_t insize,
-                                 const LodePNGDecompressSettings* settings) {
+                                 const LodePNGDecompressSettings* settings, InflateSink* sink) {
   unsigned BFINAL = 0;
   LodePNGBitReader reader;
   unsigned error = LodePNGBitReader_init(&reader, in, insize);
 
   if(error) return error;
 
-  while(!BFINAL) {
-    unsigned BTYPE;
-    if(!ensureBits9(&reader, 3)) return 52; /*error, bit pointer will jump past memory*/
-    BFINAL = readBits(&reader, 1);
-    BTYPE = readBits(&reader, 2);
-
-    if(BTYPE == 3) return 20; /*error: invalid BTYPE*/
-    else if(BTYPE == 0) error = inflateNoCompression(out, &reader, settings); /*no compression*/
-    else error = inflateHuffmanBlock(out, &reader, BTYPE); /*compression, BTYPE 01 or 10*/
+  if(settings->parallel_for && settings->parallel_jobs > 1 && insize >= 2u * INFLATE_PARALLEL_CHUNK_SIZE) {
+    return inflateParallel(out, &reader, settings, sink);
+  }
 
+  while(!BFINAL) {
+    error = inflateBlock(out, &reader, settings, sink, &BFINAL);
     if(error) return error;
+
+    if(sink && out->size >= INFLATE_WINDOW_SIZE + sink->flushsize) {
+      error = inflateSinkFlush(out, sink, INFLATE_WINDOW_SIZE);
+      if(error) return error;
+    }
   }
 
+  if(sink) error = inflateSinkFlush(out, sink, 0);
+
   return error;
 }
 
@@ -1410,7 +2117,7 @@ unsigned lodepng_inflate(unsigned char** out, size_t* outsize,
                          const unsigned char* in, size_t insize,
                          const LodePNGDecompressSettings* settings) {
   ucvector v = ucvector_init(*out, *outsize);
-  unsigned error = lodepng_inflatev(&v, in, insize, settings);
+  unsigned error = lodepng_inflatev(&v, in, insize, settings, 0);
   *out = v.data;
   *outsize = v.size;
   return error;
@@ -1423,7 +2130,7 @@ static unsigned inflatev(ucvector* out, const unsigned char* in, size_t insize,
     out->allocsize = out->size;
     return error;
   } else {
-    return lodepng_inflatev(out, in, insize, settings);
+    return lodepng_inflatev(out, in, insize, settings, 0);
   }
 }
 
@@ -2159,10 +2866,8 @@ static unsigned adler32(const unsigned char* data, unsigned len) {
 
 #ifdef LODEPNG_COMPILE_DECODER
 
-static unsigned lodepng_zlib_decompressv(ucvector* out,
-                                         const unsigned char* in, size_t insize,
-                                         const LodePNGDecompressSettings* settings) {
-  unsigned error = 0;
+/*checks the 2 byte zlib header at the start of in*/
+static unsigned checkZlibHeader(const unsigned char* in, size_t insize) {
   unsigned CM, CINFO, FDICT;
 
   if(insize < 2) return 53; /*error, size of zlib data too small*/
@@ -2188,6 +2893,15 @@ static unsigned lodepng_zlib_decompressv(ucvector* out,
     return 26;
   }
 
+  return 0;
+}
+
+static unsigned lodepng_zlib_decompressv(ucvector* out,
+                                         const unsigned char* in, size_t insize,
+                                         const LodePNGDecompressSettings* settings) {
+  unsigned error = checkZlibHeader(in, insize);
+  if(error) return error;
+
   error = inflatev(out, in + 2, insize - 2, settings);
   if(error) return error;
 
@@ -2201,6 +2915,30 @@ static unsigned lodepng_zlib_decompressv(ucvector* out,
 }
 
 
+/*decompresses the zlib data to sink, see InflateSink. Does not support settings->custom_zlib or custom_inflate.*/
+static unsigned zlib_decompress_sink(InflateSink* sink, const unsigned char* in, size_t insize,
+                                     const LodePNGDecompressSettings* settings) {
+  ucvector v = ucvector_init(0, 0);
+  unsigned error = checkZlibHeader(in, insize);
+  if(error) return error;
+
+  /*reserve the whole window up front, to avoid reallocations*/
+  if(!ucvector_resize(&v, INFLATE_WINDOW_SIZE + sink->flushsize + 65536u)) return 83; /*alloc fail*/
+  v.size = 0;
+
+  sink->adler = 1u;
+  error = lodepng_inflatev(&v, in + 2, insize - 2, settings, sink);
+  lodepng_free(v.data);
+  if(error) return error;
+
+  if(!settings->ignore_adler32) {
+    unsigned ADLER32 = lodepng_read32bitInt(&in[insize - 4]);
+    if(sink->adler != ADLER32) return 58; /*error, adler checksum not correct, data must be corrupted*/
+  }
+
+  return 0; /*no error*/
+}
+
 unsigned lodepng_zlib_decompress(unsigned char** out, size_t* outsize, const unsigned char* in,
                                  size_t insize, const LodePNGDecompressSettings* settings) {
   ucvector v = ucvector_init(*out, *outsize);
@@ -2338,9 +3076,12 @@ void lodepng_decompress_settings_init(LodePNGDecompressSettings* settings) {
   settings->custom_zlib = 0;
   settings->custom_inflate = 0;
   settings->custom_context = 0;
+
+  settings->parallel_for = 0;
+  settings->parallel_jobs = 0;
 }
 
-const LodePNGDecompressSettings lodepng_default_decompress_settings = {0, 0, 0, 0, 0};
+const LodePNGDecompressSettings lodepng_default_decompress_settings = {0, 0, 0, 0, 0, 0, 0};
 
 #endif /*LODEPNG_COMPILE_DECODER*/
 
@@ -4077,8 +4818,193 @@ unsigned lodepng_inspect(unsigned* w, unsigned* h, LodePNGState* state,
   return state->error;
 }
 
+#ifdef LODEPNG_COMPILE_SSE
+/*gcc and clang only allow the intrinsics in functions built for that instruction set, VS anywhere*/
+#if defined(__GNUC__) || defined(__clang__)
+#define LODEPNG_TARGET_SSE2 __attribute__((target("sse2")))
+#define LODEPNG_TARGET_SSE41 __attribute__((target("sse4.1")))
+#else
+#define LODEPNG_TARGET_SSE2
+#define LODEPNG_TARGET_SSE41
+#endif
+
+#define LODEPNG_CPU_KNOWN 1u
+#define LODEPNG_CPU_SSE2 2u
+#define LODEPNG_CPU_SSE41 4u
+
+/*returns the LODEPNG_CPU_ flags. cpuid is slow (and may trap to a hypervisor), so the decoders ask once per
+image and pass the flags down to every scanline, rather than sharing a cache between threads*/
+static unsigned lodepng_cpu_features(void) {
+  unsigned info[4] = {0, 0, 0, 0};
+#ifdef _MSC_VER
+  __cpuid((int*)info, 1);
+#else
+  __get_cpuid(1, &info[0], &info[1], &info[2], &info[3]);
+#endif
+  return LODEPNG_CPU_KNOWN | (((info[3] >> 26u) & 1u) ? LODEPNG_CPU_SSE2 : 0)
+       | (((info[2] >> 19u) & 1u) ? LODEPNG_CPU_SSE41 : 0);
+}
+
+/*loads/stores one pixel of bytewidth 3 or 4 in the lowest bytes of the register. The sizes are spelled out
+so they are plain moves, the branches are always predicted. While there are 4 bytes left in the line, the load
+of a 3 byte pixel takes the next byte along, into a lane that is never stored.*/
+LODEPNG_TARGET_SSE2 static LODEPNG_INLINE __m128i loadPixelSSE2(const unsigned char* p, size_t left) {
+  unsigned v;
+  if(left >= 4) memcpy(&v, p, 4);
+  else v = (unsigned)p[0] | ((unsigned)p[1] << 8u) | ((unsigned)p[2] << 16u);
+  return _mm_cvtsi32_si128((int)v);
+}
+
+LODEPNG_TARGET_SSE2 static LODEPNG_INLINE void storePixelSSE2(unsigned char* p, __m128i v, size_t bytewidth) {
+  unsigned u = (unsigned)_mm_cvtsi128_si32(v);
+  if(bytewidth == 4) {
+    memcpy(p, &u, 4);
+  } else {
+    p[0] = (unsigned char)u;
+    p[1] = (unsigned char)(u >> 8u);
+    p[2] = (unsigned char)(u >> 16u);
+  }
+}
+
+/*Up does not depend on the pixel to the left, so this takes 16 bytes at a time, for any bytewidth*/
+LODEPNG_TARGET_SSE2 static void unfilterUpSSE2(unsigned char* recon, const unsigned char* scanline,
+                                               const unsigned char* precon, size_t length) {
+  size_t i;
+  for(i = 0; i + 16 <= length; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i*)&scanline[i]);
+    __m128i b = _mm_loadu_si128((const __m128i*)&precon[i]);
+    _mm_storeu_si128((__m128i*)&recon[i], _mm_add_epi8(x, b));
+  }
+  for(; i != length; ++i) recon[i] = scanline[i] + precon[i];
+}
+
+/*Sub, 4 pixels at a time: adds the last pixel so far to the first one, then sums the 4 up in 2 shifted adds.
+With bytewidth 3 that is 12 of the 16 loaded bytes, only those are stored since recon may be scanline.*/
+LODEPNG_TARGET_SSE2 static void unfilterSubSSE2(unsigned char* recon, const unsigned char* scanline,
+                                                size_t bytewidth, size_t length) {
+  __m128i a = _mm_setzero_si128(); /*the last pixel so far, in the lowest bytes*/
+  size_t i = 0;
+  if(bytewidth == 4) {
+    for(; i + 16 <= length; i += 16) {
+      __m128i x = _mm_add_epi8(_mm_loadu_si128((const __m128i*)&scanline[i]), a);
+      x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+      x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+      _mm_storeu_si128((__m128i*)&recon[i], x);
+      a = _mm_srli_si128(x, 12);
+    }
+  } else /*bytewidth == 3*/ {
+    for(; i + 16 <= length; i += 12) {
+      __m128i x = _mm_add_epi8(_mm_loadu_si128((const __m128i*)&scanline[i]), a);
+      x = _mm_add_epi8(x, _mm_slli_si128(x, 3));
+      x = _mm_add_epi8(x, _mm_slli_si128(x, 6));
+      _mm_storel_epi64((__m128i*)&recon[i], x);
+      storePixelSSE2(&recon[i + 8], _mm_srli_si128(x, 8), 4);
+      a = _mm_srli_si128(_mm_slli_si128(x, 4), 13);
+    }
+  }
+  for(; i != length; ++i) recon[i] = (i < bytewidth) ? scanline[i] : scanline[i] + recon[i - bytewidth];
+}
+
+/*Avg and Paeth depend on the finished pixel to the left, so these go a pixel at a time, with the channels in
+parallel. The pixel left of the first one is taken as 0, which gives the same as the scalar first pixel.*/
+LODEPNG_TARGET_SSE2 static void unfilterAvgSSE2(unsigned char* recon, const unsigned char* scanline,
+                                                const unsigned char* precon, size_t bytewidth, size_t length) {
+  const __m128i one = _mm_set1_epi8(1);
+  __m128i a = _mm_setzero_si128();
+  size_t i;
+  for(i = 0; i + bytewidth <= length; i += bytewidth) {
+    __m128i b = loadPixelSSE2(&precon[i], length - i);
+    /*(a + b) >> 1: avg_epu8 rounds up, so take away the bit it added*/
+    __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+    a = _mm_add_epi8(loadPixelSSE2(&scanline[i], length - i), avg);
+    storePixelSSE2(&recon[i], a, bytewidth);
+  }
+}
+
+/*a, b, c and the distances are 16-bit lanes, as is the left pixel that is carried from pixel to pixel. Picks
+the same as paethPredictor (b if pb < pa, then c if pc is smaller than that). Only pb, pc and the selects depend on
+the left pixel, pa and the rest are worked out beside that chain.*/
+LODEPNG_TARGET_SSE2 static void unfilterPaethSSE2(unsigned char* recon, const unsigned char* scanline,
+                                                  const unsigned char* precon, size_t bytewidth, size_t length) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i lowbyte = _mm_set1_epi16(0xff);
+  __m128i a = zero, c = zero; /*left and upper left*/
+  size_t i;
+  for(i = 0; i + bytewidth <= length; i += bytewidth) {
+    __m128i b = _mm_unpacklo_epi8(loadPixelSSE2(&precon[i], length - i), zero);
+    __m128i x = _mm_unpacklo_epi8(loadPixelSSE2(&scanline[i], length - i), zero);
+    __m128i bc = _mm_sub_epi16(b, c);
+    __m128i pa = _mm_max_epi16(bc, _mm_sub_epi16(zero, bc));
+    __m128i pb = _mm_sub_epi16(a, c);
+    __m128i pc = _mm_add_epi16(pb, bc);
+    __m128i useb, usec, predictor;
+    pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+    pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+    useb = _mm_cmplt_epi16(pb, pa);
+    usec = _mm_cmplt_epi16(pc, _mm_min_epi16(pa, pb));
+    predictor = _mm_or_si128(_mm_and_si128(useb, b), _mm_andnot_si128(useb, a));
+    predictor = _mm_or_si128(_mm_and_si128(usec, c), _mm_andnot_si128(usec, predictor));
+    a = _mm_and_si128(_mm_add_epi16(x, predictor), lowbyte);
+    storePixelSSE2(&recon[i], _mm_packus_epi16(a, a), bytewidth);
+    c = b;
+  }
+}
+
+/*the same with SSSE3 abs and SSE4.1 blends, which shortens the chain through the left pixel*/
+LODEPNG_TARGET_SSE41 static void unfilterPaethSSE41(unsigned char* recon, const unsigned char* scanline,
+                                                    const unsigned char* precon, size_t bytewidth, size_t length) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i lowbyte = _mm_set1_epi16(0xff);
+  __m128i a = zero, c = zero; /*left and upper left*/
+  size_t i;
+  for(i = 0; i + bytewidth <= length; i += bytewidth) {
+    __m128i b = _mm_unpacklo_epi8(loadPixelSSE2(&precon[i], length - i), zero);
+    __m128i x = _mm_unpacklo_epi8(loadPixelSSE2(&scanline[i], length - i), zero);
+    __m128i bc = _mm_sub_epi16(b, c);
+    __m128i pa = _mm_abs_epi16(bc);
+    __m128i pb = _mm_sub_epi16(a, c);
+    __m128i pc = _mm_abs_epi16(_mm_add_epi16(pb, bc));
+    __m128i useb, usec, predictor;
+    pb = _mm_abs_epi16(pb);
+    useb = _mm_cmplt_epi16(pb, pa);
+    usec = _mm_cmplt_epi16(pc, _mm_min_epi16(pa, pb));
+    predictor = _mm_blendv_epi8(_mm_blendv_epi8(a, b, useb), c, usec);
+    a = _mm_and_si128(_mm_add_epi16(x, predictor), lowbyte);
+    storePixelSSE2(&recon[i], _mm_packus_epi16(a, a), bytewidth);
+    c = b;
+  }
+}
+
+/*returns whether a SIMD kernel did the scanline: Up for any bytewidth, the others for 3 and 4 (8-bit RGB and
+RGBA), and not for a first scanline since those are cheap*/
+static int unfilterScanlineSSE(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                               size_t bytewidth, unsigned char filterType, size_t length, unsigned features) {
+  if(!(features & LODEPNG_CPU_SSE2)) return 0;
+  if(filterType == 2 && precon) {
+    unfilterUpSSE2(recon, scanline, precon, length);
+    return 1;
+  }
+  if(bytewidth != 3 && bytewidth != 4) return 0;
+  if(filterType == 1) {
+    unfilterSubSSE2(recon, scanline, bytewidth, length);
+  } else if(filterType == 3 && precon) {
+    unfilterAvgSSE2(recon, scanline, precon, bytewidth, length);
+  } else if(filterType == 4 && precon) {
+    if(features & LODEPNG_CPU_SSE41) unfilterPaethSSE41(recon, scanline, precon, bytewidth, length);
+    else unfilterPaethSSE2(recon, scanline, precon, bytewidth, length);
+  } else {
+    return 0;
+  }
+  return 1;
+}
+#else /*LODEPNG_COMPILE_SSE*/
+static unsigned lodepng_cpu_features(void) {
+  return 0;
+}
+#endif /*LODEPNG_COMPILE_SSE*/
+
 static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
-                                 size_t bytewidth, unsigned char filterType, size_t length) {
+                                 size_t bytewidth, unsigned char filterType, size_t length, unsigned cpu) {
   /*
   For PNG filter method 0
   unfilter a PNG image scanline by scanline. when the pixels are smaller than 1 byte,
@@ -4086,9 +5012,15 @@ static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scan
   precon is the previous unfiltered scanline, recon the result, scanline the current one
   the incoming scanlines do NOT include the filtertype byte, that one is given in the parameter filterType instead
   recon and scanline MAY be the same memory address! precon must be disjoint.
+  cpu are the flags of lodepng_cpu_features
   */
 
   size_t i;
+#ifdef LODEPNG_COMPILE_SSE
+  if(unfilterScanlineSSE(recon, scanline, precon, bytewidth, filterType, length, cpu)) return 0;
+#else /*LODEPNG_COMPILE_SSE*/
+  (void)cpu;
+#endif /*LODEPNG_COMPILE_SSE*/
   switch(filterType) {
     case 0:
       for(i = 0; i != length; ++i) recon[i] = scanline[i];
@@ -4185,6 +5117,7 @@ static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w
 
   unsigned y;
   unsigned char* prevline = 0;
+  unsigned cpu = lodepng_cpu_features();
 
   /*bytewidth is used for filtering, is 1 when bpp < 8, number of bytes per pixel otherwise*/
   size_t bytewidth = (bpp + 7u) / 8u;
@@ -4196,7 +5129,7 @@ static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w
     size_t inindex = (1 + linebytes) * y; /*the extra filterbyte added to each row*/
     unsigned char filterType = in[inindex];
 
-    CERROR_TRY_RETURN(unfilterScanline(&out[outindex], &in[inindex + 1], prevline, bytewidth, filterType, linebytes));
+    CERROR_TRY_RETURN(unfilterScanline(&out[outindex], &in[inindex + 1], prevline, bytewidth, filterType, linebytes, cpu));
 
     prevline = &out[outindex];
   }
@@ -4716,17 +5649,15 @@ unsigned lodepng_inspect_chunk(LodePNGState* state, size_t pos,
   return error;
 }
 
-/*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
-static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
-                          LodePNGState* state,
-                          const unsigned char* in, size_t insize) {
+/*reads the header and all chunks of a PNG, and points *idat at the data of its idat chunks (zlib compressed).
+A single idat chunk is used where it is in the in buffer, several are concatenated into *idatbuffer (to be freed
+by the caller, also when an error happened)*/
+static void decodeChunks(const unsigned char** idat, size_t* idatsize, unsigned char** idatbuffer,
+                         unsigned* w, unsigned* h, LodePNGState* state,
+                         const unsigned char* in, size_t insize) {
   unsigned char IEND = 0;
   const unsigned char* chunk;
-  unsigned char* idat; /*the data from idat chunks, zlib compressed*/
-  size_t idatsize = 0;
-  unsigned char* scanlines = 0;
-  size_t scanlines_size = 0, expected_size = 0;
-  size_t outsize = 0;
+  unsigned numidat = 0;
 
   /*for unknown chunk order*/
   unsigned unknown = 0;
@@ -4736,7 +5667,9 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
 
 
   /* safe output values in case error happens */
-  *out = 0;
+  *idat = in;
+  *idatsize = 0;
+  *idatbuffer = 0;
   *w = *h = 0;
 
   state->error = lodepng_inspect(w, h, state, in, insize); /*reads header and resets other parameters in state->info_png*/
@@ -4746,14 +5679,9 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
     CERROR_RETURN(state->error, 92); /*overflow possible due to amount of pixels*/
   }
 
-  /*the input filesize is a safe upper bound for the sum of idat chunks size*/
-  idat = (unsigned char*)lodepng_malloc(insize);
-  if(!idat) CERROR_RETURN(state->error, 83); /*alloc fail*/
-
   chunk = &in[33]; /*first byte of the first chunk after the header*/
 
-  /*loop through the chunks, ignoring unknown chunks and stopping at IEND chunk.
-  IDAT data is put at the start of the in buffer*/
+  /*loop through the chunks, ignoring unknown chunks and stopping at IEND chunk*/
   while(!IEND && !state->error) {
     unsigned chunkLength;
     const unsigned char* data; /*the data in the chunk*/
@@ -4783,10 +5711,19 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
     /*IDAT chunk, containing compressed image data*/
     if(lodepng_chunk_type_equals(chunk, "IDAT")) {
       size_t newsize;
-      if(lodepng_addofl(idatsize, chunkLength, &newsize)) CERROR_BREAK(state->error, 95);
+      if(lodepng_addofl(*idatsize, chunkLength, &newsize)) CERROR_BREAK(state->error, 95);
       if(newsize > insize) CERROR_BREAK(state->error, 95);
-      lodepng_memcpy(idat + idatsize, data, chunkLength);
-      idatsize += chunkLength;
+      if(numidat == 1) {
+        /*the input filesize is a safe upper bound for the sum of idat chunks size*/
+        *idatbuffer = (unsigned char*)lodepng_malloc(insize);
+        if(!*idatbuffer) CERROR_BREAK(state->error, 83); /*alloc fail*/
+        lodepng_memcpy(*idatbuffer, *idat, *idatsize);
+        *idat = *idatbuffer;
+      }
+      if(numidat == 0) *idat = data;
+      else lodepng_memcpy(*idatbuffer + *idatsize, data, chunkLength);
+      *idatsize = newsize;
+      ++numidat;
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
       critical_pos = 3;
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
@@ -4874,6 +5811,23 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
   if(state->info_png.color.colortype == LCT_PALETTE && !state->info_png.color.palette) {
     state->error = 106; /* error: PNG file must have PLTE chunk if color type is palette */
   }
+}
+
+/*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
+static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
+                          LodePNGState* state,
+                          const unsigned char* in, size_t insize) {
+  const unsigned char* idat; /*the data from idat chunks, zlib compressed*/
+  size_t idatsize = 0;
+  unsigned char* idatbuffer;
+  unsigned char* scanlines = 0;
+  size_t scanlines_size = 0, expected_size = 0;
+  size_t outsize = 0;
+
+  /* safe output values in case error happens */
+  *out = 0;
+
+  decodeChunks(&idat, &idatsize, &idatbuffer, w, h, state, in, insize);
 
   if(!state->error) {
     /*predict output size, to allocate exact size for output buffer to avoid more dynamic allocation.
@@ -4897,7 +5851,7 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
     state->error = zlib_decompress(&scanlines, &scanlines_size, expected_size, idat, idatsize, &state->decoder.zlibsettings);
   }
   if(!state->error && scanlines_size != expected_size) state->error = 91; /*decompressed size doesn't match prediction*/
-  lodepng_free(idat);
+  lodepng_free(idatbuffer);
 
   if(!state->error) {
     outsize = lodepng_get_raw_size(*w, *h, &state->info_png.color);
@@ -4968,6 +5922,138 @@ unsigned lodepng_decode24(unsigned char** out, unsigned* w, unsigned* h, const u
   return lodepng_decode_memory(out, w, h, in, insize, LCT_RGB, 8);
 }
 
+/*state of lodepng_decode_scanlines, receiving the inflated scanlines as an InflateSink*/
+typedef struct ScanlineDecoder {
+  InflateSink sink; /*must be the first member*/
+  const LodePNGColorMode* color; /*color mode of the PNG*/
+  const LodePNGColorMode* color_out; /*color mode of the scanlines passed to the callback*/
+  unsigned w, h;
+  size_t bytewidth, linebytes; /*linebytes excludes the filter type byte*/
+  size_t outlinebytes; /*size of a scanline passed to the callback, padded to whole bytes*/
+  unsigned char* filtered; /*a filtered scanline (with filter type byte) split over two writes*/
+  size_t filteredpos;
+  unsigned char* linebuffer; /*the two unfiltered scanlines of filter state, in the color mode of the PNG*/
+  unsigned char* prevline; /*the half of linebuffer holding the previous scanline, or 0 at the first one*/
+  unsigned char* lines; /*the converted scanlines of the batch*/
+  unsigned y, batchlines, numlines; /*first row and height of the batch, and rows of it done so far*/
+  unsigned cpu; /*see lodepng_cpu_features*/
+  LodePNGScanlineCallback callback;
+  void* user;
+} ScanlineDecoder;
+
+static unsigned scanlineDecoderAddLine(ScanlineDecoder* d, const unsigned char* filtered) {
+  /*unfilterScanline needs the scanline and the previous one to be disjoint, so they alternate*/
+  unsigned char* line = d->prevline == d->linebuffer ? d->linebuffer + d->linebytes : d->linebuffer;
+  unsigned error;
+
+  if(d->y + d->numlines >= d->h) return 91; /*more data than the image has scanlines*/
+  error = unfilterScanline(line, filtered + 1, d->prevline, d->bytewidth, filtered[0], d->linebytes, d->cpu);
+  if(error) return error;
+  d->prevline = line;
+
+  /*converted one scanline at a time, since lodepng_convert expects no padding bits between them*/
+  error = lodepng_convert(d->lines + d->numlines * d->outlinebytes, line, d->color_out, d->color, d->w, 1);
+  if(error) return error;
+
+  if(++d->numlines == d->batchlines || d->y + d->numlines == d->h) {
+    error = d->callback(d->lines, d->y, d->numlines, d->user);
+    if(error) return error;
+    d->y += d->numlines;
+    d->numlines = 0;
+  }
+  return 0;
+}
+
+static unsigned scanlineDecoderWrite(InflateSink* sink, const unsigned char* data, size_t size) {
+  ScanlineDecoder* d = (ScanlineDecoder*)sink;
+  size_t filteredbytes = d->linebytes + 1u;
+  unsigned error;
+
+  while(size != 0) {
+    if(d->filteredpos == 0 && size >= filteredbytes) {
+      /*whole scanline available, unfilter it straight from the inflated data*/
+      error = scanlineDecoderAddLine(d, data);
+      if(error) return error;
+      data += filteredbytes;
+      size -= filteredbytes;
+    } else {
+      size_t amount = filteredbytes - d->filteredpos;
+      if(amount > size) amount = size;
+      lodepng_memcpy(d->filtered + d->filteredpos, data, amount);
+      d->filteredpos += amount;
+      data += amount;
+      size -= amount;
+      if(d->filteredpos == filteredbytes) {
+        d->filteredpos = 0;
+        error = scanlineDecoderAddLine(d, d->filtered);
+        if(error) return error;
+      }
+    }
+  }
+  return 0;
+}
+
+unsigned lodepng_decode_scanlines(unsigned* w, unsigned* h, LodePNGState* state,
+                                  const unsigned char* in, size_t insize,
+                                  unsigned batchlines, LodePNGScanlineCallback callback, void* user) {
+  ScanlineDecoder d;
+  const unsigned char* idat;
+  size_t idatsize;
+  unsigned char* idatbuffer;
+
+  d.filtered = d.linebuffer = d.lines = 0;
+
+  decodeChunks(&idat, &idatsize, &idatbuffer, w, h, state, in, insize);
+  if(!state->error && batchlines == 0) state->error = 109; /*invalid number of scanlines per callback*/
+  if(!state->error && state->info_png.interlace_method != 0) state->error = 110; /*not in top to bottom order*/
+  if(!state->error && (state->decoder.zlibsettings.custom_zlib || state->decoder.zlibsettings.custom_inflate)) {
+    state->error = 111; /*the custom functions inflate all of the data at once*/
+  }
+  if(!state->error && !state->decoder.color_convert) {
+    state->error = lodepng_color_mode_copy(&state->info_raw, &state->info_png.color);
+  }
+  if(!state->error && !lodepng_color_mode_equal(&state->info_raw, &state->info_png.color)
+     && !(state->info_raw.colortype == LCT_RGB || state->info_raw.colortype == LCT_RGBA)
+     && !(state->info_raw.bitdepth == 8)) {
+    state->error = 56; /*unsupported color mode conversion, see lodepng_decode*/
+  }
+
+  if(!state->error) {
+    unsigned bpp = lodepng_get_bpp(&state->info_png.color);
+    d.color = &state->info_png.color;
+    d.color_out = &state->info_raw;
+    d.w = *w;
+    d.h = *h;
+    d.bytewidth = (bpp + 7u) / 8u;
+    d.linebytes = lodepng_get_raw_size_idat(*w, 1, bpp) - 1u;
+    d.outlinebytes = lodepng_get_raw_size(*w, 1, &state->info_raw);
+    d.filteredpos = 0;
+    d.prevline = 0;
+    d.cpu = lodepng_cpu_features();
+    d.y = d.numlines = 0;
+    d.batchlines = batchlines < *h ? batchlines : *h;
+    d.callback = callback;
+    d.user = user;
+    /*flush to the scanline decoder in pieces of about a batch*/
+    d.sink.write = scanlineDecoderWrite;
+    d.sink.flushsize = d.batchlines * (d.linebytes + 1u);
+
+    d.filtered = (unsigned char*)lodepng_malloc(d.linebytes + 1u);
+    d.linebuffer = (unsigned char*)lodepng_malloc(2u * d.linebytes);
+    d.lines = (unsigned char*)lodepng_malloc(d.batchlines * d.outlinebytes);
+    if(!d.filtered || !d.linebuffer || !d.lines) state->error = 83; /*alloc fail*/
+  }
+
+  if(!state->error) state->error = zlib_decompress_sink(&d.sink, idat, idatsize, &state->decoder.zlibsettings);
+  if(!state->error && (d.y != d.h || d.filteredpos != 0)) state->error = 91; /*size doesn't match the image*/
+
+  lodepng_free(idatbuffer);
+  lodepng_free(d.filtered);
+  lodepng_free(d.linebuffer);
+  lodepng_free(d.lines);
+  return state->error;
+}
+
 #ifdef LODEPNG_COMPILE_DISK
 unsigned lodepng_decode_file(unsigned char** out, unsigned* w, unsigned* h, const char* filename,
                              LodePNGColorType colortype, unsigned bitdepth) {
@@ -6204,6 +7290,9 @@ const char* lodepng_error_text(unsigned code) {
     case 106: return "PNG file must have PLTE chunk if color type is palette";
     case 107: return "color convert from palette mode requested without setting the palette data in it";
     case 108: return "tried to add more than 256 values to a palette";
+    case 109: return "invalid number of scanlines per callback for lodepng_decode_scanlines, must be at least 1";
+    case 110: return "lodepng_decode_scanlines does not support Adam7 interlaced PNGs";
+    case 111: return "lodepng_decode_scanlines does not support custom_zlib or custom_inflate";
   }
   return "unknown error code";
 }
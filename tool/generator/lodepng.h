@@ -37,7 +37,9 @@ The "NO_COMPILE" defines are designed to be used to pass as defines to the
 compiler command to disable them without modifying this header, e.g.
 -DLODEPNG_NO_COMPILE_ZLIB for gcc.
 In addition to those below, you can also define LODEPNG_NO_COMPILE_CRC to
-allow implementing a custom lodepng_crc32.
+allow implementing a custom lodepng_crc32, LODEPNG_NO_COMPILE_FAST_INFLATE
+to decode all huffman blocks with the plain (slower) loop, and
+LODEPNG_NO_COMPILE_SIMD to unfilter without the SSE2/SSE4.1 kernels.
 */
 /*deflate & zlib. If disabled, you must specify alternative zlib functions in
 the custom_zlib field of the compress and decompress settings*/
@@ -138,6 +140,15 @@ unsigned lodepng_decode32(unsigned char** out, unsigned* w, unsigned* h,
 unsigned lodepng_decode24(unsigned char** out, unsigned* w, unsigned* h,
                           const unsigned char* in, size_t insize);
 
+/*
+Receives numlines decoded scanlines from lodepng_decode_scanlines, of which the first is row y of the
+image. They are in the color mode of state->info_raw, each padded to a whole number of bytes (so with
+bit depths below 8 there may be padding bits between them, unlike in the image lodepng_decode gives).
+The scanlines are only valid during the call. Return 0 to continue decoding, or any other value to stop,
+which lodepng_decode_scanlines then returns.
+*/
+typedef unsigned (*LodePNGScanlineCallback)(const unsigned char* lines, unsigned y, unsigned numlines, void* user);
+
 #ifdef LODEPNG_COMPILE_DISK
 /*
 Load PNG from disk, from file with given name.
@@ -281,6 +292,15 @@ struct LodePNGDecompressSettings {
                              const LodePNGDecompressSettings*);
 
   const void* custom_context; /*optional custom settings for custom functions*/
+
+  /*Inflate large streams (of at least 4MB) on several threads (default: null). lodepng does not create threads
+  itself: parallel_for must call job(jobs, i) for every i from 0 to numjobs - 1, in any order or at the same time,
+  and return when they are all done. The stream is inflated in rounds of parallel_jobs pieces of 2MB of it, all but
+  the first starting at a guessed dynamic huffman block, so this costs some extra work and memory per piece. Not
+  used when parallel_jobs is below 2, or with custom_zlib or custom_inflate.*/
+  void (*parallel_for)(void (*job)(void* jobs, unsigned i), void* jobs, unsigned numjobs,
+                       const LodePNGDecompressSettings* settings);
+  unsigned parallel_jobs; /*pieces per round, usually the number of threads*/
 };
 
 extern const LodePNGDecompressSettings lodepng_default_decompress_settings;
@@ -763,6 +783,19 @@ unsigned lodepng_decode(unsigned char** out, unsigned* w, unsigned* h,
                         LodePNGState* state,
                         const unsigned char* in, size_t insize);
 
+/*
+Same as lodepng_decode, but instead of giving the whole image in one buffer, passes it to callback
+in batches of batchlines scanlines (top to bottom, the last batch may be smaller). Inflates the IDAT
+data a bit at a time and keeps only two scanlines to unfilter, so besides the PNG itself, memory use
+is just a batch of scanlines and the 32K deflate window, whatever the size of the image.
+Use lodepng_inspect to get the size and color mode of the image before decoding it.
+Does not support Adam7 interlaced PNGs, nor custom zlib or inflate functions (returns an error for those).
+*/
+unsigned lodepng_decode_scanlines(unsigned* w, unsigned* h,
+                                  LodePNGState* state,
+                                  const unsigned char* in, size_t insize,
+                                  unsigned batchlines, LodePNGScanlineCallback callback, void* user);
+
 /*
 Read the PNG header, but not the actual data. This returns only the information
 that is in the IHDR chunk of the PNG, such as width, height and color type. The
@@ -57,6 +57,11 @@ public:
         return Vec3(mX + other.mX, mY + other.mY, mZ + other.mZ);
     }
 
+    Vec3 operator -(const Vec3& other) const
+    {
+        return Vec3(mX - other.mX, mY - other.mY, mZ - other.mZ);
+    }
+
     Vec3& operator +=(const Vec3& other)
     {
         mX += other.mX;
@@ -65,6 +70,11 @@ public:
         return *this;
     }
 
+    float Dot(const Vec3& other) const
+    {
+        return mX * other.mX + mY * other.mY + mZ * other.mZ;
+    }
+
     float mX, mY, mZ;
 };
 